@@ -29,6 +29,8 @@
 #include <linux/hwmon-sysfs.h>
 #include <linux/sysfs.h>
 
+#include "hwassyv.h"
+
 enum hwassyv_bits {
     BIT0 = 0,
     BIT1,
@@ -38,12 +40,24 @@ enum hwassyv_bits {
 };
 
 struct hwassyv_platform_data {
+#ifndef CONFIG_HWASSYV_MINIMAL
     unsigned int gpios[MAX_BITS];   // array of gpios where index = bit
+#endif
     unsigned int table_index;       // 4-bit number created from gpio's
     const char *revision;           // string text holding board revision
+#ifndef CONFIG_HWASSYV_MINIMAL
     char name[PLATFORM_NAME_SIZE];
+#endif
 };
 
+/* the minimal profile keeps the errno but drops the message text */
+#ifdef CONFIG_HWASSYV_MINIMAL
+#define hwassyv_err(dev, fmt, ...)  do { } while (0)
+#else
+#define hwassyv_err(dev, fmt, ...)  dev_err(dev, fmt, ##__VA_ARGS__)
+#endif
+
+#ifndef CONFIG_HWASSYV_MINIMAL
 struct hwassyv_data {
 
     struct device *hwmon_dev;
@@ -51,6 +65,7 @@ struct hwassyv_data {
     struct device *dev;    
     int use_count;
 };
+#endif
 
 const char *const bit_names[] = {
     [BIT0]   = "addr0",
@@ -60,6 +75,79 @@ const char *const bit_names[] = {
 
 };
 
+static struct platform_driver hwassyv_driver;
+
+/*
+ * In-kernel API: the revision is latched once at probe, so consumers get a
+ * copy of the binary snapshot without any text formatting. Available in
+ * both the full and the CONFIG_HWASSYV_MINIMAL profile (where drvdata is
+ * the pdata itself).
+ *
+ * pdata is devm-allocated and freed on unbind, so it is only looked up
+ * with the device lock held and the values are copied out before it is
+ * dropped. The returned revision points into the DT lookup-table
+ * property, which outlives the binding.
+ */
+static struct hwassyv_platform_data *hwassyv_get_pdata(struct device *dev)
+{
+#ifdef CONFIG_HWASSYV_MINIMAL
+    struct hwassyv_platform_data *pdata;
+#else
+    struct hwassyv_data *data;
+#endif
+
+    /* caller holds device_lock(dev) */
+    if (dev->driver != &hwassyv_driver.driver)
+        return NULL;
+
+#ifdef CONFIG_HWASSYV_MINIMAL
+    pdata = dev_get_drvdata(dev);
+
+    return pdata;
+#else
+    data = dev_get_drvdata(dev);
+
+    return data ? data->pdata : NULL;
+#endif
+}
+
+int hwassyv_get_index(struct device *dev)
+{
+    struct hwassyv_platform_data *pdata;
+    int index = -ENODEV;
+
+    if (!dev)
+        return -ENODEV;
+
+    device_lock(dev);
+    pdata = hwassyv_get_pdata(dev);
+    if (pdata)
+        index = pdata->table_index;
+    device_unlock(dev);
+
+    return index;
+}
+EXPORT_SYMBOL_GPL(hwassyv_get_index);
+
+const char *hwassyv_get_revision(struct device *dev)
+{
+    struct hwassyv_platform_data *pdata;
+    const char *revision = ERR_PTR(-ENODEV);
+
+    if (!dev)
+        return revision;
+
+    device_lock(dev);
+    pdata = hwassyv_get_pdata(dev);
+    if (pdata)
+        revision = pdata->revision;
+    device_unlock(dev);
+
+    return revision;
+}
+EXPORT_SYMBOL_GPL(hwassyv_get_revision);
+
+#ifndef CONFIG_HWASSYV_MINIMAL
 static ssize_t hwassyv_show_version(struct device *dev,
         struct device_attribute *attr, char *buf)
 {
@@ -87,6 +175,7 @@ static ssize_t hwassyv_show_name(struct device *dev,
 static DEVICE_ATTR(board_rev, S_IRUGO, hwassyv_show_version, NULL);
 static DEVICE_ATTR(list_index, S_IRUGO, hwassyv_show_index, NULL);
 static DEVICE_ATTR(name, S_IRUGO, hwassyv_show_name, NULL);
+#endif /* CONFIG_HWASSYV_MINIMAL */
 
 static struct of_device_id hwassyv_of_match[] = {
     { .compatible = "hwassy-rev" },
@@ -102,6 +191,7 @@ static struct hwassyv_platform_data *hwassyv_parse_dt(struct platform_device *pd
     int length;
     int index;
     unsigned int gpio_num;
+    unsigned int gpios[MAX_BITS] = { 0 };
     int cntr;
     int retval = 0;
 
@@ -111,21 +201,21 @@ static struct hwassyv_platform_data *hwassyv_parse_dt(struct platform_device *pd
     length = of_property_count_strings(node, "lookup-table");
 
     if (length < 1) {
-        dev_err(&pdev->dev, "there should be AT LEAST one revision...\n");
+        hwassyv_err(&pdev->dev, "there should be AT LEAST one revision...\n");
         return ERR_PTR(-ENODATA); 
     }
     
     length = of_property_count_strings(node, "ref-bits");
     
     if (length != 4) {
-        dev_err(&pdev->dev, "four names required to identify our bits, no more, no less...\n"); 
+        hwassyv_err(&pdev->dev, "four names required to identify our bits, no more, no less...\n"); 
         return ERR_PTR(-EINVAL);
     }
 
     length = of_count_phandle_with_args(node, "gpios", "#gpio-cells");
     
     if (length != 4) {
-        dev_err(&pdev->dev, "four gpios required to make our index, no more, no less...\n"); 
+        hwassyv_err(&pdev->dev, "four gpios required to make our index, no more, no less...\n"); 
         return ERR_PTR(-EINVAL);
     }
     
@@ -147,12 +237,12 @@ static struct hwassyv_platform_data *hwassyv_parse_dt(struct platform_device *pd
                 gpio_free(gpio_num);
                 goto err;
             }
-            pdata->gpios[cntr] = gpio_num;           
+            gpios[cntr] = gpio_num;           
             dev_dbg(&pdev->dev, "found %s for our hwassy version index\n", bit_names[cntr]);
             index = -ENODATA;
         }
         else {
-            dev_err(&pdev->dev, "couldn't find a matching name for %s\n", bit_names[cntr]); 
+            hwassyv_err(&pdev->dev, "couldn't find a matching name for %s\n", bit_names[cntr]); 
             goto err;
         }
     }
@@ -160,16 +250,24 @@ static struct hwassyv_platform_data *hwassyv_parse_dt(struct platform_device *pd
     pdata->table_index = 0;
     cntr = BIT3;
     do {
-        if (gpio_get_value(pdata->gpios[cntr]))
+        if (gpio_get_value(gpios[cntr]))
             pdata->table_index |= 1;
         pdata->table_index = (cntr != BIT0) ? pdata->table_index << 1 : pdata->table_index;
     } while (cntr-- > BIT0);
       
     if (pdata->table_index > 15) {
-        dev_err(&pdev->dev, "something went wrong determining our table index\n"); 
+        hwassyv_err(&pdev->dev, "something went wrong determining our table index\n"); 
         retval = -EINVAL;
         goto err;
     }
+
+#ifdef CONFIG_HWASSYV_MINIMAL
+    /* only the snapshot is kept; release the straps so a rebind can request them */
+    for (cntr = BIT0; cntr < MAX_BITS; cntr++)
+        gpio_free(gpios[cntr]);
+#else
+    memcpy(pdata->gpios, gpios, sizeof(gpios));
+#endif
     
     retval = of_property_read_string_index(node, "lookup-table", pdata->table_index, &pdata->revision);
     
@@ -181,8 +279,8 @@ static struct hwassyv_platform_data *hwassyv_parse_dt(struct platform_device *pd
 err:
 
     for (cntr = BIT0; cntr < MAX_BITS; cntr++) {
-        if (pdata->gpios[cntr] > 0)
-            gpio_free(pdata->gpios[cntr]);   
+        if (gpios[cntr] > 0)
+            gpio_free(gpios[cntr]);   
     }
     kfree(pdata);
     return ERR_PTR(retval);
@@ -190,9 +288,11 @@ err:
 
 static int hwassyv_dt_probe(struct platform_device *pdev)
 {
-    struct hwassyv_data *data;
     struct hwassyv_platform_data *pdata;
+#ifndef CONFIG_HWASSYV_MINIMAL
+    struct hwassyv_data *data;
     int ret;
+#endif
     
     pdata = hwassyv_parse_dt(pdev);
     
@@ -202,20 +302,27 @@ static int hwassyv_dt_probe(struct platform_device *pdev)
         pdata = pdev->dev.platform_data;
 
     if (!pdata) {
-        dev_err(&pdev->dev, "No platform init data supplied.\n");
+        hwassyv_err(&pdev->dev, "No platform init data supplied.\n");
         return -ENODEV;
     }
-  
+
+#ifdef CONFIG_HWASSYV_MINIMAL
+    /* minimal profile: snapshot only, served through the in-kernel API */
+    platform_set_drvdata(pdev, pdata);
+
+    return 0;
+#else
     data = devm_kzalloc(&pdev->dev, sizeof(struct hwassyv_data), GFP_KERNEL);
     if (!data)
         return -ENOMEM;
         
     data->dev = &pdev->dev;
     data->pdata = pdata;
-    strlcpy(pdata->name, dev_name(&pdev->dev), sizeof(pdata->name));
     
     platform_set_drvdata(pdev, data);
 
+    strlcpy(pdata->name, dev_name(&pdev->dev), sizeof(pdata->name));
+
     data->hwmon_dev = hwmon_device_register(data->dev);
     if (IS_ERR(data->hwmon_dev)) {
         dev_err(data->dev, "failed to register hw/assy version reporting driver\n\n");
@@ -257,11 +364,12 @@ err_free_mem:
     kfree(data);
     kfree(pdata);
     return ret;
-    
+#endif /* CONFIG_HWASSYV_MINIMAL */
 }
 
 static int hwassyv_remove(struct platform_device *pdev)
 {
+#ifndef CONFIG_HWASSYV_MINIMAL
     struct hwassyv_data *data = platform_get_drvdata(pdev);
 
     device_remove_file(data->hwmon_dev, &dev_attr_name);
@@ -269,6 +377,7 @@ static int hwassyv_remove(struct platform_device *pdev)
     device_remove_file(data->hwmon_dev, &dev_attr_list_index);
     hwmon_device_unregister(data->hwmon_dev);
     dev_set_drvdata(data->hwmon_dev, NULL);
+#endif
     platform_set_drvdata(pdev, NULL);
 
     return 0;
@@ -0,0 +1,39 @@
+/*
+ * Generic HW/ASSY Version Reporting Driver - in-kernel API
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * Author: Cody Tudor <cody.tudor@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef __HWASSYV_H__
+#define __HWASSYV_H__
+
+struct device;
+
+/*
+ * @dev: the platform device bound to the hwassy-rev driver
+ *
+ * hwassyv_get_index() returns the 4-bit lookup-table index or -ENODEV.
+ * hwassyv_get_revision() returns the lookup-table string or ERR_PTR(-ENODEV).
+ *
+ * The caller must hold a reference on @dev (e.g. from get_device() or
+ * bus_find_device()) so the struct device itself stays valid. Both calls
+ * take device_lock(@dev) to serialize against unbind, so they may sleep
+ * and must not be called with that lock already held.
+ */
+int hwassyv_get_index(struct device *dev);
+const char *hwassyv_get_revision(struct device *dev);
+
+#endif /* __HWASSYV_H__ */
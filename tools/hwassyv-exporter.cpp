@@ -0,0 +1,338 @@
+/*
+ * hwassyv-exporter - OpenMetrics exporter for HW/ASSY board revisions
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Each scrape costs one readdir() of the hwmon class plus one pread()
+ * of a cached board_rev fd per instance; nothing is forked. 'name' and
+ * 'list_index' never change while the device stays bound, so they are
+ * read once when board_rev is opened. A failing pread() means the
+ * device was unbound; hwmon IDs are reused, so the entry is reopened
+ * rather than trusted.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+#include "hwassyv_sysfs.h"
+
+#define EXPORTER_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+#define EXPORTER_IO_TIMEOUT   2   // seconds a scraper may stall a request
+
+struct exporter_instance {
+    std::string name;
+    int list_index;
+    int rev_fd;
+    bool seen;
+};
+
+static std::map<std::string, exporter_instance> instances;   // keyed by hwmonN
+static std::string sysfs_root = HWASSYV_HWMON_ROOT;
+
+/* open board_rev and latch name/list_index; false if not one of ours */
+static bool instance_open(const std::string &hwmon, exporter_instance &inst)
+{
+    std::string dir = sysfs_root + "/" + hwmon;
+    std::string text;
+
+    inst.rev_fd = open((dir + "/board_rev").c_str(), O_RDONLY | O_CLOEXEC);
+    if (inst.rev_fd < 0) {
+        if (errno != ENOENT && errno != ENOTDIR)
+            fprintf(stderr, "hwassyv-exporter: %s/board_rev: %s\n", dir.c_str(),
+                    strerror(errno));
+        return false;
+    }
+    if (!hwassyv_read_attr(dir + "/name", inst.name))
+        inst.name = hwmon;
+    inst.list_index = hwassyv_read_attr(dir + "/list_index", text) ?
+                      hwassyv_parse_index(text) : -1;
+    return true;
+}
+
+/* drop vanished hwmon devices, open attributes of new ones */
+static void refresh_instances(void)
+{
+    DIR *d = opendir(sysfs_root.c_str());
+    struct dirent *ent;
+
+    for (auto &it : instances)
+        it.second.seen = false;
+
+    if (d) {
+        while ((ent = readdir(d)) != NULL) {
+            exporter_instance inst;
+
+            if (ent->d_name[0] == '.')
+                continue;
+
+            auto it = instances.find(ent->d_name);
+            if (it != instances.end()) {
+                it->second.seen = true;
+                continue;
+            }
+
+            if (!instance_open(ent->d_name, inst))
+                continue;
+            inst.seen = true;
+            instances[ent->d_name] = inst;
+        }
+        closedir(d);
+    }
+
+    for (auto it = instances.begin(); it != instances.end();) {
+        if (!it->second.seen) {
+            close(it->second.rev_fd);
+            it = instances.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+static void append_label_value(std::string &out, const std::string &val)
+{
+    for (char ch : val) {
+        if (ch == '\\' || ch == '"')
+            out += '\\';
+        if (ch == '\n')
+            out += "\\n";
+        else
+            out += ch;
+    }
+}
+
+static void scrape(std::string &out)
+{
+    std::string index_block;
+    std::string rev;
+    size_t count = 0;
+
+    refresh_instances();
+
+    out.clear();
+    out += "# TYPE hwassyv_board info\n"
+           "# HELP hwassyv_board HW/ASSY revision string selected by the board's GPIO straps.\n";
+    index_block = "# TYPE hwassyv_table_index gauge\n"
+                  "# HELP hwassyv_table_index 4-bit lookup-table index read from the GPIO straps.\n";
+
+    for (auto it = instances.begin(); it != instances.end();) {
+        exporter_instance &inst = it->second;
+
+        if (!hwassyv_pread_attr(inst.rev_fd, rev)) {
+            /* unbound, possibly rebound under the same hwmonN */
+            close(inst.rev_fd);
+            if (!instance_open(it->first, inst)) {
+                it = instances.erase(it);
+                continue;
+            }
+            if (!hwassyv_pread_attr(inst.rev_fd, rev)) {
+                close(inst.rev_fd);
+                it = instances.erase(it);
+                continue;
+            }
+        }
+        ++it;
+        count++;
+
+        out += "hwassyv_board_info{device=\"";
+        append_label_value(out, inst.name);
+        out += "\",revision=\"";
+        append_label_value(out, rev);
+        out += "\"} 1\n";
+
+        if (inst.list_index >= 0) {
+            index_block += "hwassyv_table_index{device=\"";
+            append_label_value(index_block, inst.name);
+            index_block += "\"} " + std::to_string(inst.list_index) + "\n";
+        }
+    }
+
+    out += index_block;
+    out += "# TYPE hwassyv_instances gauge\n"
+           "# HELP hwassyv_instances Number of bound hwassyv devices.\n"
+           "hwassyv_instances " + std::to_string(count) + "\n"
+           "# EOF\n";
+}
+
+static double cpu_seconds(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static double wall_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(int iterations)
+{
+    std::string out;
+    double cpu0, wall0, cpu1, wall1;
+
+    scrape(out);    // first scrape opens every attribute
+    cpu0 = cpu_seconds();
+    wall0 = wall_seconds();
+    for (int i = 0; i < iterations; i++)
+        scrape(out);
+    cpu1 = cpu_seconds();
+    wall1 = wall_seconds();
+
+    printf("instances:  %zu\n", instances.size());
+    printf("scrapes:    %d\n", iterations);
+    printf("output:     %zu bytes/scrape\n", out.size());
+    printf("cpu time:   %.1f us/scrape\n", (cpu1 - cpu0) / iterations * 1e6);
+    printf("wall time:  %.1f us/scrape\n", (wall1 - wall0) / iterations * 1e6);
+    return 0;
+}
+
+static void write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+/*
+ * Scrapes arrive every few seconds from a single collector, so requests
+ * are handled one at a time; only "GET /metrics" is served.
+ */
+static int serve(int port)
+{
+    struct sockaddr_in addr = {};
+    std::string body;
+    int one = 1;
+    int lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (lfd < 0) {
+        perror("hwassyv-exporter: socket");
+        return 1;
+    }
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 16) < 0) {
+        perror("hwassyv-exporter: bind/listen");
+        close(lfd);
+        return 1;
+    }
+
+    for (;;) {
+        struct timeval tv = { EXPORTER_IO_TIMEOUT, 0 };
+        char req[1024];
+        std::string hdr;
+        ssize_t n;
+        int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+
+        if (fd < 0)
+            continue;
+
+        /* a connection that never sends must not stall later scrapes */
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        n = read(fd, req, sizeof(req) - 1);
+        if (n > 0) {
+            req[n] = '\0';
+            if (strncmp(req, "GET /metrics ", 13) == 0) {
+                scrape(body);
+                hdr = "HTTP/1.0 200 OK\r\nContent-Type: " EXPORTER_CONTENT_TYPE
+                      "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+                write_all(fd, hdr.data(), hdr.size());
+                write_all(fd, body.data(), body.size());
+            } else {
+                static const char nf[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+
+                write_all(fd, nf, sizeof(nf) - 1);
+            }
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-r sysfs_root] [-l port | -b iterations]\n"
+            "  -r  hwmon class directory (default " HWASSYV_HWMON_ROOT ")\n"
+            "  -l  serve /metrics over HTTP on this port\n"
+            "  -b  time this many scrapes and report per-scrape CPU time\n"
+            "  with neither -l nor -b a single scrape is printed to stdout\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    std::string out;
+    int port = 0;
+    int iterations = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:l:b:h")) != -1) {
+        switch (opt) {
+        case 'r':
+            sysfs_root = optarg;
+            break;
+        case 'l':
+            port = atoi(optarg);
+            break;
+        case 'b':
+            iterations = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    hwassyv_raise_fd_limit();
+
+    if (iterations > 0)
+        return bench(iterations);
+    if (port > 0)
+        return serve(port);
+
+    scrape(out);
+    fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * hwassyv - print HW/ASSY board revisions as text or JSON
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Interfaces live in the backends[] table. Without -i, the auto-selected
+ * ones are tried in table order and the first that is available and
+ * reads successfully is used; a failing backend falls through to the
+ * next. New interfaces only need a probe/read pair added to that table.
+ *
+ * Every backend treats "no boards bound" as a failure, so the exit
+ * status doesn't depend on which interface answered.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "hwassyv_sysfs.h"
+
+#define HWASSYVD_TIMEOUT_MS 500     // a stalled daemon falls back to sysfs
+
+static std::string sysfs_root = HWASSYV_HWMON_ROOT;
+static std::string sock_path = HWASSYVD_SOCKET;
+
+struct hwassyv_backend {
+    const char *name;
+    bool auto_select;       // false: only used when requested with -i
+    bool (*probe)(void);
+    bool (*read)(std::vector<hwassyv_instance> &list);
+};
+
+static int daemon_connect(void)
+{
+    struct sockaddr_un addr = {};
+    struct timeval tv = { 0, HWASSYVD_TIMEOUT_MS * 1000 };
+    int fd;
+
+    if (sock_path.size() >= sizeof(addr.sun_path))
+        return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock_path.c_str());
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* existence check only; a dead socket fails in daemon_read() and falls through */
+static bool daemon_probe(void)
+{
+    return access(sock_path.c_str(), F_OK) == 0;
+}
+
+/*
+ * LIST replies with "REV <name> <index> <revision>" lines and then END.
+ * The daemon only rescans periodically, so its answer is cross-checked
+ * against the number of board_rev attributes present right now; a cache
+ * that missed a freshly probed board is rejected.
+ */
+static bool daemon_read(std::vector<hwassyv_instance> &list)
+{
+    int fd = daemon_connect();
+    std::string in;
+    char buf[4096];
+    size_t start = 0;
+    size_t nl;
+
+    if (fd < 0)
+        return false;
+    if (write(fd, "LIST\n", 5) != 5) {
+        close(fd);
+        return false;
+    }
+    while (!hwassyv_list_complete(in)) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+
+        if (n <= 0) {
+            close(fd);
+            return false;
+        }
+        in.append(buf, n);
+    }
+    close(fd);
+
+    list.clear();
+    while ((nl = in.find('\n', start)) != std::string::npos) {
+        std::string line = in.substr(start, nl - start);
+        size_t sp1, sp2;
+        hwassyv_instance inst;
+
+        start = nl + 1;
+        if (line.compare(0, 4, "REV ") != 0)
+            continue;
+        sp1 = line.find(' ', 4);
+        sp2 = (sp1 == std::string::npos) ? sp1 : line.find(' ', sp1 + 1);
+        if (sp2 == std::string::npos)
+            continue;
+        inst.name = line.substr(4, sp1 - 4);
+        inst.list_index = atoi(line.c_str() + sp1 + 1);
+        inst.board_rev = line.substr(sp2 + 1);
+        list.push_back(inst);
+    }
+    return !list.empty() && list.size() == hwassyv_count(sysfs_root, 0);
+}
+
+static bool sysfs_text_probe(void)
+{
+    return hwassyv_count(sysfs_root, 1) > 0;
+}
+
+static bool sysfs_text_read(std::vector<hwassyv_instance> &list)
+{
+    list = hwassyv_scan(sysfs_root);
+    return !list.empty();
+}
+
+/*
+ * The driver only exposes the legacy text attributes, and they are the
+ * authoritative source. hwassyvd answers from a cache that is only as
+ * fresh as its last rescan, so it is cross-checked against sysfs on
+ * every read and only used when requested with -i.
+ */
+static const hwassyv_backend backends[] = {
+    { "sysfs-text", true,  sysfs_text_probe, sysfs_text_read },
+    { "hwassyvd",   false, daemon_probe,     daemon_read },
+};
+
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static const hwassyv_backend *find_backend(const char *name)
+{
+    for (size_t i = 0; i < NUM_BACKENDS; i++) {
+        if (strcmp(backends[i].name, name) == 0)
+            return &backends[i];
+    }
+    return NULL;
+}
+
+static void print_json_string(const std::string &s)
+{
+    putchar('"');
+    for (unsigned char ch : s) {
+        if (ch == '"' || ch == '\\')
+            printf("\\%c", ch);
+        else if (ch < 0x20)
+            printf("\\u%04x", ch);
+        else
+            putchar(ch);
+    }
+    putchar('"');
+}
+
+static void print_json(const hwassyv_backend *be, const std::vector<hwassyv_instance> &list)
+{
+    printf("{\"interface\":\"%s\",\"devices\":[", be->name);
+    for (size_t i = 0; i < list.size(); i++) {
+        printf("%s{\"name\":", i ? "," : "");
+        print_json_string(list[i].name);
+        printf(",\"revision\":");
+        print_json_string(list[i].board_rev);
+        printf(",\"index\":%d}", list[i].list_index);
+    }
+    printf("]}\n");
+}
+
+static void print_text(const hwassyv_backend *be, const std::vector<hwassyv_instance> &list)
+{
+    fprintf(stderr, "interface: %s\n", be->name);
+    for (const hwassyv_instance &inst : list)
+        printf("%s: %s (index %d)\n", inst.name.c_str(), inst.board_rev.c_str(),
+               inst.list_index);
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int bench(int iterations)
+{
+    std::vector<hwassyv_instance> list;
+
+    printf("%-12s %10s %12s\n", "interface", "instances", "us/read");
+    for (size_t i = 0; i < NUM_BACKENDS; i++) {
+        const hwassyv_backend *be = &backends[i];
+        bool ok = true;
+        double t0;
+
+        if (!be->probe()) {
+            printf("%-12s %10s %12s\n", be->name, "-", "unavailable");
+            continue;
+        }
+        t0 = now_us();
+        for (int n = 0; n < iterations && ok; n++)
+            ok = be->probe() && be->read(list);
+        if (!ok)
+            printf("%-12s %10s %12s\n", be->name, "-", "failed");
+        else
+            printf("%-12s %10zu %12.1f\n", be->name, list.size(),
+                   (now_us() - t0) / iterations);
+    }
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-j] [-i interface] [-b iterations] [-r sysfs_root] [-s socket]\n"
+            "  -j  print JSON instead of text\n"
+            "  -i  force an interface instead of auto-selecting\n"
+            "  -b  time probe + read of every available interface over this many runs\n"
+            "  -r  hwmon class directory (default " HWASSYV_HWMON_ROOT ")\n"
+            "  -s  hwassyvd socket (default " HWASSYVD_SOCKET ")\n"
+            "interfaces (* = auto-selected):",
+            prog);
+    for (size_t i = 0; i < NUM_BACKENDS; i++)
+        fprintf(stderr, " %s%s", backends[i].name, backends[i].auto_select ? "*" : "");
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    const hwassyv_backend *be = NULL;
+    std::vector<hwassyv_instance> list;
+    bool json = false;
+    int iterations = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ji:b:r:s:h")) != -1) {
+        switch (opt) {
+        case 'j':
+            json = true;
+            break;
+        case 'i':
+            be = find_backend(optarg);
+            if (!be) {
+                fprintf(stderr, "hwassyv: unknown interface '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'b':
+            iterations = atoi(optarg);
+            break;
+        case 'r':
+            sysfs_root = optarg;
+            break;
+        case 's':
+            sock_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (iterations > 0)
+        return bench(iterations);
+
+    if (be) {
+        if (!be->read(list)) {
+            fprintf(stderr, "hwassyv: reading via %s failed\n", be->name);
+            return 1;
+        }
+    } else {
+        for (size_t i = 0; i < NUM_BACKENDS && !be; i++) {
+            if (backends[i].auto_select && backends[i].probe() && backends[i].read(list))
+                be = &backends[i];
+        }
+        if (!be) {
+            fprintf(stderr, "hwassyv: no HW/ASSY revision interface found\n");
+            return 1;
+        }
+    }
+
+    if (json)
+        print_json(be, list);
+    else
+        print_text(be, list);
+    return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Generic HW/ASSY Version Reporting - userspace sysfs helpers
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef HWASSYV_SYSFS_H
+#define HWASSYV_SYSFS_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define HWASSYV_HWMON_ROOT "/sys/class/hwmon"
+#define HWASSYVD_SOCKET    "/run/hwassyvd.sock"
+
+struct hwassyv_instance {
+    std::string dir;        // hwmon class directory, e.g. /sys/class/hwmon/hwmon3
+    std::string name;       // contents of 'name' (platform dev name)
+    std::string board_rev;  // contents of 'board_rev' without the newline
+    int list_index;         // parsed from 'list_index', -1 if unreadable
+};
+
+/*
+ * Read a sysfs attribute from an already open fd. sysfs always serves the
+ * whole value from offset 0, so a single pread() is enough and the fd can
+ * be kept open and re-read (or poll()ed) for the lifetime of the caller.
+ */
+static inline bool hwassyv_pread_attr(int fd, std::string &out)
+{
+    char buf[256];
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+
+    if (len < 0)
+        return false;
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\0'))
+        len--;
+    out.assign(buf, len);
+    return true;
+}
+
+static inline bool hwassyv_read_attr(const std::string &path, std::string &out)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    bool ok;
+
+    if (fd < 0)
+        return false;
+    ok = hwassyv_pread_attr(fd, out);
+    close(fd);
+    return ok;
+}
+
+/* list_index is formatted as "lookup-table index: %d" by the driver */
+static inline int hwassyv_parse_index(const std::string &text)
+{
+    size_t colon = text.rfind(':');
+    const char *num = text.c_str() + (colon == std::string::npos ? 0 : colon + 1);
+    char *end;
+    long val = strtol(num, &end, 10);
+
+    return (end == num) ? -1 : (int)val;
+}
+
+static inline bool hwassyv_load(const std::string &dir, hwassyv_instance &inst)
+{
+    std::string index;
+
+    inst.dir = dir;
+    if (!hwassyv_read_attr(dir + "/board_rev", inst.board_rev))
+        return false;
+    if (!hwassyv_read_attr(dir + "/name", inst.name))
+        inst.name = dir.substr(dir.rfind('/') + 1);
+    inst.list_index = hwassyv_read_attr(dir + "/list_index", index) ?
+                      hwassyv_parse_index(index) : -1;
+    return true;
+}
+
+/*
+ * hwassyvd terminates a LIST reply with an "END" line. Match the whole
+ * line so a revision that merely ends in END (e.g. LEGEND) at a read
+ * boundary isn't taken for it.
+ */
+static inline bool hwassyv_list_complete(const std::string &in)
+{
+    return in == "END\n" ||
+           (in.size() >= 5 && in.compare(in.size() - 5, 5, "\nEND\n") == 0);
+}
+
+/*
+ * Long-running tools hold one or more fds per instance or client, so the
+ * usual 1024 soft limit is lifted to the hard limit at startup.
+ */
+static inline void hwassyv_raise_fd_limit(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur >= rl.rlim_max)
+        return;
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+}
+
+/*
+ * Number of hwmon class devices carrying board_rev, without reading any
+ * attribute; stops early once 'limit' (if non-zero) have been found.
+ */
+static inline size_t hwassyv_count(const std::string &root, size_t limit)
+{
+    DIR *d = opendir(root.c_str());
+    struct dirent *ent;
+    size_t count = 0;
+
+    if (!d)
+        return 0;
+
+    while ((ent = readdir(d)) != NULL && (!limit || count < limit)) {
+        if (ent->d_name[0] == '.')
+            continue;
+        if (faccessat(dirfd(d), (std::string(ent->d_name) + "/board_rev").c_str(),
+                      R_OK, 0) == 0)
+            count++;
+    }
+    closedir(d);
+    return count;
+}
+
+/*
+ * Every hwmon class device that carries a board_rev attribute belongs to
+ * this driver. Results are sorted by name so output is stable.
+ */
+static inline std::vector<hwassyv_instance> hwassyv_scan(const std::string &root)
+{
+    std::vector<hwassyv_instance> list;
+    DIR *d = opendir(root.c_str());
+    struct dirent *ent;
+
+    if (!d)
+        return list;
+
+    while ((ent = readdir(d)) != NULL) {
+        hwassyv_instance inst;
+
+        if (ent->d_name[0] == '.')
+            continue;
+        if (hwassyv_load(root + "/" + ent->d_name, inst))
+            list.push_back(inst);
+    }
+    closedir(d);
+
+    std::sort(list.begin(), list.end(),
+              [](const hwassyv_instance &a, const hwassyv_instance &b) {
+                  return a.name < b.name;
+              });
+    return list;
+}
+
+#endif /* HWASSYV_SYSFS_H */
@@ -0,0 +1,234 @@
+/*
+ * hwassyvd-loadtest - closed-loop query load generator for hwassyvd
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Opens N concurrent connections; each one keeps exactly one GET in
+ * flight for the test duration. Reports queries/second and the latency
+ * distribution measured from write() to the reply's newline.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hwassyv_sysfs.h"
+
+struct loadtest_conn {
+    int fd;
+    uint64_t sent_ns;
+    std::string in;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int connect_daemon(const char *path)
+{
+    struct sockaddr_un addr = {};
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0)
+        return -1;
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* blocking round trip used once to discover a device name */
+static bool first_name(const char *path, std::string &name)
+{
+    int fd = connect_daemon(path);
+    std::string in;
+    char buf[4096];
+
+    if (fd < 0 || write(fd, "LIST\n", 5) != 5)
+        return false;
+    while (!hwassyv_list_complete(in)) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+
+        if (n <= 0)
+            break;
+        in.append(buf, n);
+    }
+    close(fd);
+
+    /* "REV <name> <index> <revision>" */
+    if (in.compare(0, 4, "REV ") != 0)
+        return false;
+    name = in.substr(4, in.find(' ', 4) - 4);
+    return true;
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+    size_t idx;
+
+    if (sorted.empty())
+        return 0;
+    idx = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[idx];
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-s socket] [-c clients] [-d seconds] [-n name]\n"
+            "  -s  daemon socket (default " HWASSYVD_SOCKET ")\n"
+            "  -c  concurrent connections (default 2000)\n"
+            "  -d  test duration in seconds (default 5)\n"
+            "  -n  device name to GET (default: first entry of LIST)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *sock_path = HWASSYVD_SOCKET;
+    size_t nclients = 2000;
+    int duration = 5;
+    std::string name;
+    std::string request;
+    std::vector<loadtest_conn> conns;
+    std::vector<uint64_t> lat;
+    struct epoll_event events[512];
+    uint64_t start, deadline, end;
+    size_t errors = 0;
+    int epfd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:c:d:n:h")) != -1) {
+        switch (opt) {
+        case 's':
+            sock_path = optarg;
+            break;
+        case 'c':
+            nclients = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    hwassyv_raise_fd_limit();
+
+    if (name.empty() && !first_name(sock_path, name)) {
+        fprintf(stderr, "hwassyvd-loadtest: no instances reported by %s\n", sock_path);
+        return 1;
+    }
+    request = "GET " + name + "\n";
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    conns.resize(nclients);
+    for (size_t i = 0; i < nclients; i++) {
+        struct epoll_event ev = {};
+        int fd = connect_daemon(sock_path);
+
+        if (fd < 0) {
+            fprintf(stderr, "hwassyvd-loadtest: connect #%zu: %s\n", i, strerror(errno));
+            return 1;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        conns[i].fd = fd;
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    lat.reserve(1 << 22);
+    start = now_ns();
+    deadline = start + (uint64_t)duration * 1000000000ull;
+
+    for (loadtest_conn &c : conns) {
+        c.sent_ns = now_ns();
+        if (write(c.fd, request.data(), request.size()) != (ssize_t)request.size())
+            errors++;
+    }
+
+    while (now_ns() < deadline) {
+        int n = epoll_wait(epfd, events, 512, 100);
+
+        for (int i = 0; i < n; i++) {
+            loadtest_conn &c = conns[events[i].data.u64];
+            char buf[512];
+            ssize_t len = read(c.fd, buf, sizeof(buf));
+            size_t nl;
+
+            if (len <= 0) {
+                if (len < 0 && errno == EAGAIN)
+                    continue;
+                errors++;
+                epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, NULL);
+                continue;
+            }
+            c.in.append(buf, len);
+            while ((nl = c.in.find('\n')) != std::string::npos) {
+                uint64_t t = now_ns();
+
+                if (c.in.compare(0, 4, "REV ") != 0)
+                    errors++;
+                lat.push_back(t - c.sent_ns);
+                c.in.erase(0, nl + 1);
+                c.sent_ns = t;
+                if (write(c.fd, request.data(), request.size()) != (ssize_t)request.size())
+                    errors++;
+            }
+        }
+    }
+    end = now_ns();
+
+    for (loadtest_conn &c : conns)
+        close(c.fd);
+    close(epfd);
+
+    std::sort(lat.begin(), lat.end());
+    printf("clients:   %zu\n", nclients);
+    printf("duration:  %.2f s\n", (end - start) / 1e9);
+    printf("queries:   %zu (%zu errors)\n", lat.size(), errors);
+    printf("qps:       %.0f\n", lat.size() / ((end - start) / 1e9));
+    printf("latency:   p50 %.1f us  p90 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us\n",
+           percentile(lat, 50) / 1e3, percentile(lat, 90) / 1e3,
+           percentile(lat, 99) / 1e3, percentile(lat, 99.9) / 1e3,
+           lat.empty() ? 0.0 : lat.back() / 1e3);
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,659 @@
+/*
+ * hwassyvd - HW/ASSY revision caching daemon
+ *
+ * Copyleft 2016 Tudor Design Systems, LLC.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Holds the state of every hwassyv instance and answers queries over a
+ * Unix stream socket so short-lived processes don't each hit sysfs.
+ * The cache is refreshed when board_rev signals POLLPRI (sysfs_notify)
+ * and by a periodic rescan that also picks up newly probed boards.
+ *
+ * Line protocol (one request per line):
+ *   GET <name>   ->  REV <name> <index> <revision>   | ERR no such device
+ *   LIST         ->  REV ... lines followed by END
+ *   SUB [fields] ->  OK, then EVENT <name> <index> <revision> on change
+ *                    and REMOVED <name> when an instance goes away
+ *   UNSUB        ->  OK
+ *
+ * [fields] is a comma separated subset of revision,index,presence
+ * (default: all). A subscriber is only written to, and so only woken,
+ * when one of its fields changes.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "hwassyv_sysfs.h"
+
+#define HWASSYVD_MAX_EVENTS 256
+#define HWASSYVD_MAX_LINE   512
+#define HWASSYVD_MAX_OUTBUF (64 * 1024)  // slow subscribers are dropped past this
+
+enum hwassyvd_fields {
+    FIELD_REVISION = 1 << 0,    // board_rev string
+    FIELD_INDEX    = 1 << 1,    // list_index
+    FIELD_PRESENCE = 1 << 2,    // instance appeared or went away
+    FIELD_ALL      = FIELD_REVISION | FIELD_INDEX | FIELD_PRESENCE,
+};
+
+static const struct {
+    const char *name;
+    unsigned int mask;
+} field_names[] = {
+    { "revision", FIELD_REVISION },
+    { "index",    FIELD_INDEX },
+    { "presence", FIELD_PRESENCE },
+};
+
+struct hwassyvd_entry {
+    hwassyv_instance inst;
+    int rev_fd;             // board_rev kept open for pread()/POLLPRI
+    std::string reply;      // preformatted "REV ..." line
+};
+
+struct hwassyvd_client {
+    std::string in;
+    std::string out;
+    unsigned int fields;    // subscribed hwassyvd_fields, 0 if not subscribed
+    bool closing;           // peer sent EOF; close once 'out' has drained
+};
+
+static std::vector<hwassyvd_entry> entries;
+static std::unordered_map<std::string, size_t> by_name;
+static std::unordered_map<int, size_t> by_rev_fd;
+static std::unordered_map<int, hwassyvd_client> clients;
+static std::unordered_map<std::string, hwassyv_instance> last_seen;  // removed, by name
+static std::string list_reply;
+static std::string sysfs_root = HWASSYV_HWMON_ROOT;
+static int epfd = -1;
+static int listen_fd = -1;
+static int timer_fd = -1;
+static bool accept_paused;  // out of fds, listen_fd removed from EPOLLIN
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static std::string format_rev(const char *tag, const hwassyv_instance &inst)
+{
+    return std::string(tag) + " " + inst.name + " " +
+           std::to_string(inst.list_index) + " " + inst.board_rev + "\n";
+}
+
+static void rebuild_list_reply(void)
+{
+    list_reply.clear();
+    for (const hwassyvd_entry &e : entries)
+        list_reply += e.reply;
+    list_reply += "END\n";
+}
+
+static void listen_set_paused(bool paused)
+{
+    struct epoll_event ev = {};
+
+    if (paused == accept_paused)
+        return;
+    ev.events = paused ? 0u : (uint32_t)EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, listen_fd, &ev);
+    accept_paused = paused;
+}
+
+static void client_close(int fd)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    clients.erase(fd);
+    listen_set_paused(false);   // an fd is free again
+}
+
+/* a half-closed client is only waited on for writability */
+static void client_update_events(int fd, hwassyvd_client &c)
+{
+    struct epoll_event ev = {};
+
+    ev.events = (c.closing ? 0u : (uint32_t)(EPOLLIN | EPOLLRDHUP)) |
+                (c.out.empty() ? 0u : (uint32_t)EPOLLOUT);
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static bool client_flush(int fd, hwassyvd_client &c)
+{
+    while (!c.out.empty()) {
+        ssize_t n = write(fd, c.out.data(), c.out.size());
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        c.out.erase(0, n);
+    }
+    return true;
+}
+
+/*
+ * Queue a reply. The common case (empty backlog, small reply) goes
+ * straight to write() without touching epoll registration.
+ */
+static bool client_send(int fd, hwassyvd_client &c, const std::string &msg)
+{
+    bool had_backlog = !c.out.empty();
+
+    if (c.out.size() + msg.size() > HWASSYVD_MAX_OUTBUF)
+        return false;
+    c.out += msg;
+    if (!had_backlog && !client_flush(fd, c))
+        return false;
+    if (had_backlog != !c.out.empty())
+        client_update_events(fd, c);
+    return true;
+}
+
+static void broadcast(const std::string &msg, unsigned int fields)
+{
+    std::vector<int> dead;
+
+    for (auto &it : clients) {
+        if ((it.second.fields & fields) && !client_send(it.first, it.second, msg))
+            dead.push_back(it.first);
+    }
+    for (int fd : dead)
+        client_close(fd);
+}
+
+static void entry_arm(hwassyvd_entry &e, size_t idx)
+{
+    struct epoll_event ev = {};
+
+    e.rev_fd = open((e.inst.dir + "/board_rev").c_str(), O_RDONLY | O_CLOEXEC);
+    if (e.rev_fd < 0)
+        return;
+
+    /* sysfs needs one read before POLLPRI can fire */
+    if (!hwassyv_pread_attr(e.rev_fd, e.inst.board_rev)) {
+        close(e.rev_fd);
+        e.rev_fd = -1;
+        return;
+    }
+
+    ev.events = EPOLLPRI | EPOLLERR;
+    ev.data.fd = e.rev_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, e.rev_fd, &ev) < 0) {
+        /* not a pollable sysfs file; periodic rescan still covers it */
+        close(e.rev_fd);
+        e.rev_fd = -1;
+        return;
+    }
+    by_rev_fd[e.rev_fd] = idx;
+}
+
+static void entry_disarm(hwassyvd_entry &e)
+{
+    if (e.rev_fd < 0)
+        return;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, e.rev_fd, NULL);
+    close(e.rev_fd);
+    by_rev_fd.erase(e.rev_fd);
+    e.rev_fd = -1;
+}
+
+static bool same_state(const hwassyv_instance &a, const hwassyv_instance &b)
+{
+    return a.dir == b.dir && a.board_rev == b.board_rev &&
+           a.list_index == b.list_index;
+}
+
+/* a new hwmon directory means the device went away and came back */
+static unsigned int changed_fields(const hwassyv_instance &a, const hwassyv_instance &b)
+{
+    return (a.dir != b.dir ? FIELD_PRESENCE : 0) |
+           (a.board_rev != b.board_rev ? FIELD_REVISION : 0) |
+           (a.list_index != b.list_index ? FIELD_INDEX : 0);
+}
+
+static void reindex(void)
+{
+    by_name.clear();
+    by_rev_fd.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+        by_name[entries[i].inst.name] = i;
+        if (entries[i].rev_fd >= 0)
+            by_rev_fd[entries[i].rev_fd] = i;
+    }
+}
+
+/*
+ * Re-read the hwmon class directory and swap in the new cache. Events
+ * carry the mask of fields that actually differ, so a rescan that only
+ * finds, say, a new board wakes presence subscribers and nobody else.
+ */
+static void rescan(void)
+{
+    std::vector<hwassyv_instance> found = hwassyv_scan(sysfs_root);
+    std::vector<hwassyvd_entry> next;
+    std::vector<std::pair<const hwassyv_instance *, unsigned int>> changed;
+    std::vector<std::string> removed;
+    std::unordered_set<std::string> found_names;
+
+    for (const hwassyv_instance &inst : found)
+        found_names.insert(inst.name);
+    for (const hwassyvd_entry &e : entries) {
+        if (!found_names.count(e.inst.name)) {
+            removed.push_back(e.inst.name);
+            last_seen[e.inst.name] = e.inst;
+        }
+    }
+
+    next.reserve(found.size());
+    for (hwassyv_instance &inst : found) {
+        auto old = by_name.find(inst.name);
+        auto last = last_seen.find(inst.name);
+        unsigned int fields = FIELD_ALL;    // never seen: everything is new
+
+        if (last != last_seen.end()) {
+            /* rebound: revision/index subscribers care what changed meanwhile */
+            fields = FIELD_PRESENCE | changed_fields(last->second, inst);
+            last_seen.erase(last);
+        } else if (old != by_name.end()) {
+            hwassyvd_entry &prev = entries[old->second];
+
+            if (same_state(prev.inst, inst)) {
+                next.push_back(prev);
+                prev.rev_fd = -1;   // ownership moves to next
+                continue;
+            }
+            fields = changed_fields(prev.inst, inst);
+        }
+        next.push_back(hwassyvd_entry{inst, -1, format_rev("REV", inst)});
+        if (fields)
+            changed.push_back(std::make_pair(&inst, fields));
+    }
+
+    for (hwassyvd_entry &e : entries)
+        entry_disarm(e);
+
+    entries.swap(next);
+    reindex();
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].rev_fd < 0)
+            entry_arm(entries[i], i);
+    }
+    rebuild_list_reply();
+
+    for (const std::string &name : removed)
+        broadcast("REMOVED " + name + "\n", FIELD_PRESENCE);
+    for (auto &it : changed)
+        broadcast(format_rev("EVENT", *it.first), it.second);
+}
+
+static void refresh_entry(size_t idx)
+{
+    hwassyvd_entry &e = entries[idx];
+    hwassyv_instance inst = e.inst;
+    std::string index;
+    unsigned int fields;
+
+    /*
+     * An unbound instance keeps reporting EPOLLERR|EPOLLPRI and fails the
+     * read with ENODEV. That is the earliest sign it went away, so drop
+     * it from the cache and tell presence subscribers now; the rescan
+     * that follows reports it again (as a presence EVENT) if it has
+     * already been rebound.
+     */
+    if (!hwassyv_pread_attr(e.rev_fd, inst.board_rev)) {
+        std::string name = e.inst.name;
+
+        last_seen[name] = e.inst;
+        entry_disarm(e);
+        entries.erase(entries.begin() + idx);
+        reindex();
+        rebuild_list_reply();
+        broadcast("REMOVED " + name + "\n", FIELD_PRESENCE);
+        rescan();
+        return;
+    }
+    if (hwassyv_read_attr(inst.dir + "/list_index", index))
+        inst.list_index = hwassyv_parse_index(index);
+    fields = changed_fields(e.inst, inst);
+    if (!fields)
+        return;
+
+    e.inst = inst;
+    e.reply = format_rev("REV", e.inst);
+    rebuild_list_reply();
+    broadcast(format_rev("EVENT", e.inst), fields);
+}
+
+/* "revision,index" -> mask; 0 on an unknown field name */
+static unsigned int parse_fields(const std::string &list)
+{
+    unsigned int mask = 0;
+    size_t start = 0;
+
+    if (list.empty())
+        return FIELD_ALL;
+
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        std::string name = list.substr(start, comma == std::string::npos ?
+                                       std::string::npos : comma - start);
+        unsigned int bit = 0;
+
+        for (const auto &f : field_names) {
+            if (name == f.name)
+                bit = f.mask;
+        }
+        if (!bit)
+            return 0;
+        mask |= bit;
+        if (comma == std::string::npos)
+            break;
+        start = comma + 1;
+    }
+    return mask;
+}
+
+static bool handle_line(int fd, hwassyvd_client &c, const std::string &line)
+{
+    if (line.compare(0, 4, "GET ") == 0) {
+        auto it = by_name.find(line.substr(4));
+
+        if (it == by_name.end())
+            return client_send(fd, c, "ERR no such device\n");
+        return client_send(fd, c, entries[it->second].reply);
+    }
+    if (line == "LIST")
+        return client_send(fd, c, list_reply);
+    if (line == "SUB" || line.compare(0, 4, "SUB ") == 0) {
+        unsigned int fields = parse_fields(line.size() > 4 ? line.substr(4) : "");
+
+        if (!fields)
+            return client_send(fd, c, "ERR bad field\n");
+        c.fields = fields;
+        return client_send(fd, c, "OK\n");
+    }
+    if (line == "UNSUB") {
+        c.fields = 0;
+        return client_send(fd, c, "OK\n");
+    }
+    return client_send(fd, c, "ERR bad request\n");
+}
+
+static void handle_client(int fd, uint32_t events)
+{
+    auto it = clients.find(fd);
+    char buf[4096];
+
+    if (it == clients.end())
+        return;
+    hwassyvd_client &c = it->second;
+
+    if (events & EPOLLOUT) {
+        if (!client_flush(fd, c)) {
+            client_close(fd);
+            return;
+        }
+        if (c.out.empty())
+            client_update_events(fd, c);
+    }
+
+    if (!c.closing && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+        for (;;) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+
+            if (n > 0) {
+                c.in.append(buf, n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n < 0) {
+                client_close(fd);
+                return;
+            }
+            /*
+             * EOF: a client may write its request and half-close
+             * (printf ... | socat, nc -N), so answer what was buffered,
+             * including an unterminated last line, before closing.
+             */
+            c.closing = true;
+            if (!c.in.empty() && c.in.back() != '\n')
+                c.in += '\n';
+            break;
+        }
+
+        size_t start = 0;
+        size_t nl;
+
+        while ((nl = c.in.find('\n', start)) != std::string::npos) {
+            std::string line = c.in.substr(start, nl - start);
+
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            start = nl + 1;
+            if (!handle_line(fd, c, line)) {
+                client_close(fd);
+                return;
+            }
+        }
+        c.in.erase(0, start);
+        if (c.in.size() > HWASSYVD_MAX_LINE) {
+            client_close(fd);
+            return;
+        }
+    }
+
+    if (c.closing) {
+        if (c.out.empty())
+            client_close(fd);
+        else
+            client_update_events(fd, c);
+    }
+}
+
+static void handle_accept(void)
+{
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        struct epoll_event ev = {};
+
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                static bool warned;
+
+                /* level-triggered listen_fd would spin; wait for a close */
+                if (!warned)
+                    fprintf(stderr, "hwassyvd: out of file descriptors at %zu clients\n",
+                            clients.size());
+                warned = true;
+                listen_set_paused(true);
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("hwassyvd: accept");
+            }
+            return;
+        }
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        clients[fd] = hwassyvd_client{std::string(), std::string(), 0, false};
+    }
+}
+
+static int open_listener(const char *path)
+{
+    struct sockaddr_un addr = {};
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "hwassyvd: socket path too long\n");
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("hwassyvd: socket");
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        perror("hwassyvd: bind/listen");
+        close(fd);
+        return -1;
+    }
+    chmod(path, 0666);
+    return fd;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-s socket] [-r sysfs_root] [-i rescan_seconds]\n"
+            "  -s  listening socket (default " HWASSYVD_SOCKET ")\n"
+            "  -r  hwmon class directory (default " HWASSYV_HWMON_ROOT ")\n"
+            "  -i  periodic rescan interval, 0 disables (default 30)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *sock_path = HWASSYVD_SOCKET;
+    int interval = 30;
+    struct epoll_event events[HWASSYVD_MAX_EVENTS];
+    struct epoll_event ev = {};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:i:h")) != -1) {
+        switch (opt) {
+        case 's':
+            sock_path = optarg;
+            break;
+        case 'r':
+            sysfs_root = optarg;
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    hwassyv_raise_fd_limit();
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("hwassyvd: epoll_create1");
+        return 1;
+    }
+
+    listen_fd = open_listener(sock_path);
+    if (listen_fd < 0)
+        return 1;
+
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    if (interval > 0) {
+        struct itimerspec its = {};
+
+        its.it_interval.tv_sec = interval;
+        its.it_value.tv_sec = interval;
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd < 0 || timerfd_settime(timer_fd, 0, &its, NULL) < 0) {
+            perror("hwassyvd: timerfd");
+            return 1;
+        }
+        ev.events = EPOLLIN;
+        ev.data.fd = timer_fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, timer_fd, &ev);
+    }
+
+    rescan();
+    fprintf(stderr, "hwassyvd: serving %zu instance(s) on %s\n",
+            entries.size(), sock_path);
+
+    while (running) {
+        int n = epoll_wait(epfd, events, HWASSYVD_MAX_EVENTS, -1);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("hwassyvd: epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            auto rev = by_rev_fd.find(fd);
+
+            if (fd == listen_fd) {
+                handle_accept();
+            } else if (fd == timer_fd) {
+                uint64_t expirations;
+
+                if (read(timer_fd, &expirations, sizeof(expirations)) > 0)
+                    rescan();
+            } else if (rev != by_rev_fd.end()) {
+                refresh_entry(rev->second);
+            } else {
+                handle_client(fd, events[i].events);
+            }
+        }
+    }
+
+    for (auto &it : clients)
+        close(it.first);
+    for (hwassyvd_entry &e : entries)
+        entry_disarm(e);
+    close(listen_fd);
+    unlink(sock_path);
+    return 0;
+}